@@ -0,0 +1,240 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(door_request, LOG_LEVEL_DBG);
+
+#include <errno.h>
+
+#include "door_request.h"
+
+#define COAP_PATH	"door"
+#define MID_OFFSET	2
+#define TOKEN_OFFSET	4
+
+enum {
+	STATE_IDLE,
+	STATE_ARMED,
+	STATE_IN_FLIGHT,
+};
+
+static K_SEM_DEFINE(sent_sem, 0, 1);
+
+static uint8_t m_pdu[CONFIG_APP_DOOR_REQUEST_MESSAGE_SIZE];
+static size_t m_pdu_len;
+static uint8_t m_token[COAP_TOKEN_MAX_LEN];
+static uint16_t m_id;
+static atomic_t m_state = ATOMIC_INIT(STATE_IDLE);
+static struct door_request_stats m_stats;
+
+static int m_sockfd = -1;
+static struct sockaddr_in6 m_sa;
+static socklen_t m_sa_len;
+static door_request_cb_t m_cb;
+
+static int send_pdu(void)
+{
+	int ret;
+
+	ret = zsock_sendto(m_sockfd, m_pdu, m_pdu_len, 0, (struct sockaddr *)&m_sa, m_sa_len);
+	if (ret < 0) {
+		LOG_ERR("Failed to send door request, err %d", errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int wait_response(int timeout_ms)
+{
+	uint8_t buf[CONFIG_APP_DOOR_REQUEST_MESSAGE_SIZE];
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	struct zsock_pollfd fds = {
+		.fd = m_sockfd,
+		.events = ZSOCK_POLLIN,
+	};
+	struct coap_packet response;
+	k_timepoint_t end = sys_timepoint_calc(K_MSEC(timeout_ms));
+	uint8_t code;
+	int ret;
+
+	while (!sys_timepoint_expired(end)) {
+		ret = zsock_poll(&fds, 1, k_ticks_to_ms_ceil32(sys_timepoint_timeout(end).ticks));
+		if (ret < 0) {
+			return -errno;
+		}
+		if (ret == 0) {
+			break;
+		}
+
+		ret = zsock_recv(m_sockfd, buf, sizeof(buf), 0);
+		if (ret < 0) {
+			return -errno;
+		}
+
+		ret = coap_packet_parse(&response, buf, ret, NULL, 0);
+		if (ret < 0) {
+			LOG_DBG("Invalid response, err %d", ret);
+			continue;
+		}
+
+		code = coap_header_get_code(&response);
+
+		if (coap_header_get_token(&response, token) != COAP_TOKEN_MAX_LEN ||
+		    memcmp(token, m_token, COAP_TOKEN_MAX_LEN) != 0 ||
+		    code == COAP_CODE_EMPTY) {
+			LOG_DBG("Ignoring response id %u", coap_header_get_id(&response));
+			continue;
+		}
+
+		return code;
+	}
+
+	return -EAGAIN;
+}
+
+static void door_request_thread(void *p1, void *p2, void *p3)
+{
+	int timeout_ms;
+	int retransmits;
+	int ret;
+
+	while (1) {
+		k_sem_take(&sent_sem, K_FOREVER);
+
+		timeout_ms = CONFIG_COAP_INIT_ACK_TIMEOUT_MS;
+		retransmits = 0;
+
+		while (1) {
+			ret = wait_response(timeout_ms);
+			if (ret != -EAGAIN) {
+				break;
+			}
+
+			if (retransmits == CONFIG_COAP_MAX_RETRANSMIT) {
+				ret = -ETIMEDOUT;
+				break;
+			}
+
+			LOG_INF("🔁 retransmitting door request");
+
+			ret = send_pdu();
+			if (ret < 0) {
+				break;
+			}
+
+			retransmits++;
+			timeout_ms *= 2;
+		}
+
+		m_stats.retransmits = retransmits;
+
+		atomic_set(&m_state, STATE_IDLE);
+
+		if (m_cb) {
+			m_cb(ret);
+		}
+	}
+}
+
+K_THREAD_DEFINE(door_request_thread_id, CONFIG_APP_DOOR_REQUEST_STACK_SIZE,
+		door_request_thread, NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+int door_request_arm(const uint8_t *payload, size_t len)
+{
+	struct coap_packet request;
+	int ret;
+
+	if (atomic_get(&m_state) == STATE_IN_FLIGHT) {
+		return -EBUSY;
+	}
+
+	/* MID and token are placeholders, they are patched when sending */
+	ret = coap_packet_init(&request, m_pdu, sizeof(m_pdu), COAP_VERSION_1, COAP_TYPE_CON,
+			       COAP_TOKEN_MAX_LEN, m_token, COAP_METHOD_POST, 0);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_option(&request, COAP_OPTION_URI_PATH, COAP_PATH,
+					strlen(COAP_PATH));
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (payload && len) {
+		ret = coap_packet_append_payload_marker(&request);
+		if (ret < 0) {
+			return ret;
+		}
+
+		ret = coap_packet_append_payload(&request, payload, len);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	m_pdu_len = request.offset;
+	atomic_set(&m_state, STATE_ARMED);
+
+	LOG_DBG("door request armed (%u bytes)", m_pdu_len);
+
+	return 0;
+}
+
+int door_request_send(uint32_t press_cycles)
+{
+	int ret;
+
+	if (!atomic_cas(&m_state, STATE_ARMED, STATE_IN_FLIGHT)) {
+		if (atomic_get(&m_state) == STATE_IDLE) {
+			LOG_WRN("door request not armed");
+			return -EAGAIN;
+		}
+
+		return -EBUSY;
+	}
+
+	m_id = coap_next_id();
+	memcpy(m_token, coap_next_token(), COAP_TOKEN_MAX_LEN);
+
+	sys_put_be16(m_id, &m_pdu[MID_OFFSET]);
+	memcpy(&m_pdu[TOKEN_OFFSET], m_token, COAP_TOKEN_MAX_LEN);
+
+	ret = send_pdu();
+	if (ret < 0) {
+		atomic_set(&m_state, STATE_ARMED);
+		return ret;
+	}
+
+	m_stats.latency_us = k_cyc_to_us_floor32(k_cycle_get_32() - press_cycles);
+
+	LOG_INF("📡 door request sent, id %u, press to send %u us", m_id, m_stats.latency_us);
+
+	k_sem_give(&sent_sem);
+
+	return 0;
+}
+
+void door_request_get_stats(struct door_request_stats *stats)
+{
+	*stats = m_stats;
+}
+
+int door_request_init(int sockfd, const struct sockaddr *sa, socklen_t sa_len,
+		      door_request_cb_t cb)
+{
+	if (sa_len > sizeof(m_sa)) {
+		return -EINVAL;
+	}
+
+	m_sockfd = sockfd;
+	memcpy(&m_sa, sa, sa_len);
+	m_sa_len = sa_len;
+	m_cb = cb;
+
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DOOR_REQUEST_H_
+#define DOOR_REQUEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/net/socket.h>
+
+struct door_request_stats {
+	uint32_t latency_us;
+	uint8_t retransmits;
+};
+
+typedef void (*door_request_cb_t)(int16_t result_code);
+
+int door_request_init(int sockfd, const struct sockaddr *sa, socklen_t sa_len,
+		      door_request_cb_t cb);
+int door_request_arm(const uint8_t *payload, size_t len);
+int door_request_send(uint32_t press_cycles);
+void door_request_get_stats(struct door_request_stats *stats);
+
+#endif /* DOOR_REQUEST_H_ */
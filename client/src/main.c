@@ -2,7 +2,7 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/watchdog.h>
 #include <zephyr/kernel.h>
-#include <zephyr/net/coap_client.h>
+#include <zephyr/net/coap.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/pm/device.h>
 #include <zephyr/sys/reboot.h>
@@ -22,8 +22,11 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
 #include <mymodule/base/reset.h>
 #include <mymodule/base/watchdog.h>
 
+#include "door_request.h"
+#include "telemetry.h"
 
 #define BUTTON_PRESS_EVENT		BIT(0)
+#define DOOR_RESPONSE_EVENT		BIT(1)
 #define MANUAL_REBOOT_TOKEN		(uint8_t)0x38
 
 // [00:00:13.266,204] <inf> openthread: 🗞️  address added
@@ -50,22 +53,17 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
 #define DIRECT_GLOBAL_IP6_ADDRESS \
         { { { 0xfd, 0x04, 0x22, 0x40, 0, 0, 0x01, 0x02, 0xae, 0x2d, 0x71, 0xb0, 0xf8, 0x1e, 0xd5, 0xf8 } } }
 #define COAP_PORT	5683
-#define COAP_PATH	"door"
 
 
 static K_EVENT_DEFINE(button_events);
 
-static struct coap_client coap_client;
+static atomic_t press_cycles;
+static bool press_pending;
 
 
-static void on_coap_response(int16_t result_code, size_t offset,
-			     const uint8_t *payload, size_t len,
-			     bool last_block, void *user_data)
+static void on_coap_response(int16_t result_code)
 {
-	// int *sockfd = (int *)user_data;
-
-	LOG_INF("CoAP response, result_code=%d, offset=%u, len=%u, last_block=%d",
-		result_code, offset, len, last_block);
+	LOG_INF("CoAP response, result_code=%d", result_code);
 
 	if (result_code == COAP_RESPONSE_CODE_CHANGED) {
 		LOG_INF("🎉 CoAP succeeded");
@@ -76,43 +74,56 @@ static void on_coap_response(int16_t result_code, size_t offset,
 
 	openthread_request_normal_latency("coap response");
 
-	// zsock_close(*sockfd);
+	k_event_post(&button_events, DOOR_RESPONSE_EVENT);
 }
 
-static int toggle_door_state(struct coap_client *client, int sockfd, struct sockaddr *sa)
+static int arm_door_request(void)
 {
+	uint8_t payload[CONFIG_APP_TELEMETRY_MAX_SIZE];
+	size_t len = 0;
 	int ret;
-	// int sockfd;
-	struct coap_client_request request = {
-		.method = COAP_METHOD_POST,
-		.confirmable = true,
-		.path = COAP_PATH,
-		.payload = NULL,
-		.len = 0,
-		.cb = on_coap_response,
-		.options = NULL,
-		.num_options = 0,
-		// .user_data = &sockfd,
-		.user_data = NULL,
-	};
 
-	// sockfd = zsock_socket(sa->sa_family, SOCK_DGRAM, 0);
-	// if (sockfd < 0) {
-	// 	LOG_ERR("Failed to create socket, err %d", errno);
-	// 	return -errno;
-	// }
+	ret = telemetry_encode(payload, sizeof(payload), &len);
+	if (ret < 0) {
+		LOG_WRN("Arming door request without telemetry");
+	}
 
-	LOG_INF("Starting CoAP request");
+	return door_request_arm(payload, len);
+}
 
-	openthread_request_low_latency("coap request");
+static int toggle_door_state(void)
+{
+	int ret;
 
-	ret = coap_client_req(client, sockfd, sa, &request, NULL);
-	if (ret) {
+	/*
+	 * The request is pre-armed, send it before switching to low latency
+	 * as the radio can transmit right away, polling only matters for
+	 * the response.
+	 */
+	ret = door_request_send(atomic_get(&press_cycles));
+	if (ret == -EAGAIN) {
+		/* Re-arming failed or has not run yet, do it on demand */
+		ret = arm_door_request();
+		if (ret == 0) {
+			ret = door_request_send(atomic_get(&press_cycles));
+		}
+	}
+	if (ret == -EBUSY) {
+		/*
+		 * The previous request is still in flight, send this press
+		 * once it completes. Presses made meanwhile collapse into one.
+		 */
+		LOG_INF("door request in flight, press latched");
+		press_pending = true;
+		return 0;
+	}
+	if (ret < 0) {
 		LOG_ERR("Failed to send CoAP request, err %d", ret);
-		openthread_request_normal_latency("coap request error");
 		return ret;
 	}
 
+	openthread_request_low_latency("coap request");
+
 	return 0;
 }
 
@@ -182,12 +193,6 @@ int main(void)
 			OT_MESH_LOCAL_ADDR_SET | 
 			OT_HAS_NEIGHBORS);
 
-	ret = coap_client_init(&coap_client, NULL);
-	if (ret) {
-		LOG_ERR("Failed to init coap client, err %d", ret);
-		return ret;
-	}
-
 	sockfd = zsock_socket(sockaddr6.sin6_family, SOCK_DGRAM, 0);
 	if (sockfd < 0) {
 		LOG_ERR("Failed to create socket, err %d", errno);
@@ -200,6 +205,25 @@ int main(void)
 			       &mcast_hops,
                                sizeof(mcast_hops));
 
+	ret = door_request_init(sockfd, (struct sockaddr *)&sockaddr6, sizeof(sockaddr6),
+				on_coap_response);
+	if (ret < 0) {
+		LOG_ERR("Could not init door request, err %d", ret);
+		return ret;
+	}
+
+	ret = telemetry_init();
+	if (ret < 0) {
+		LOG_ERR("Could not init telemetry, err %d", ret);
+		return ret;
+	}
+
+	ret = arm_door_request();
+	if (ret < 0) {
+		LOG_ERR("Could not arm door request, err %d", ret);
+		return ret;
+	}
+
 	LOG_INF("🆗 initialized");
 
 #if defined(CONFIG_APP_SUSPEND_CONSOLE)
@@ -218,18 +242,39 @@ int main(void)
 
 	while (1) {
 		LOG_INF("💤 waiting for events");
+		/*
+		 * Don't reset on wait, a press posted while the previous
+		 * iteration ran would be wiped. Clear only what is handled.
+		 */
 		events = k_event_wait(&button_events,
-				(BUTTON_PRESS_EVENT),
-				true,
+				(BUTTON_PRESS_EVENT | DOOR_RESPONSE_EVENT),
+				false,
 				K_SECONDS(CONFIG_APP_MAIN_LOOP_PERIOD_SEC));
+		k_event_clear(&button_events, events);
 
 		LOG_INF("⏰ events: %08x", events);
 
+		/*
+		 * Re-arm before handling a press so a press delivered together
+		 * with the response is sent with a fresh request.
+		 */
+		if (events & DOOR_RESPONSE_EVENT) {
+			ret = arm_door_request();
+			if (ret == -EBUSY) {
+				LOG_DBG("door request already re-armed and sent");
+			} else if (ret < 0) {
+				LOG_ERR("Could not arm door request");
+			}
+
+			if (press_pending) {
+				press_pending = false;
+				events |= BUTTON_PRESS_EVENT;
+			}
+		}
+
 		if (events & BUTTON_PRESS_EVENT) {
 			LOG_INF("handling button press event");
-			ret = toggle_door_state(&coap_client,
-						sockfd,
-						(struct sockaddr *)&sockaddr6);
+			ret = toggle_door_state();
 			if (ret < 0) {
 				LOG_ERR("Could not toggle door state");
 			}
@@ -250,6 +295,7 @@ static bool event_handler(const struct app_event_header *eh)
 		evt = cast_button_event(eh);
 
 		if (evt->pressed) {
+			atomic_set(&press_cycles, k_cycle_get_32());
 			LOG_INF("🛎️  Button pressed");
 			k_event_post(&button_events, BUTTON_PRESS_EVENT);
 		}
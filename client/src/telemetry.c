@@ -0,0 +1,138 @@
+#include <zephyr/drivers/adc.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/thread.h>
+#include <zcbor_encode.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(telemetry, LOG_LEVEL_DBG);
+
+#include "door_request.h"
+#include "telemetry.h"
+
+#define TELEMETRY_KEY_COUNT	5
+
+#if DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+#define HAS_BATTERY 1
+static const struct adc_dt_spec battery = ADC_DT_SPEC_GET(DT_PATH(zephyr_user));
+#endif
+
+static int battery_read_mv(uint32_t *mv)
+{
+#if defined(HAS_BATTERY)
+	int16_t sample;
+	int32_t val;
+	struct adc_sequence sequence = {
+		.buffer = &sample,
+		.buffer_size = sizeof(sample),
+	};
+	int ret;
+
+	ret = adc_sequence_init_dt(&battery, &sequence);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = adc_read(battery.dev, &sequence);
+	if (ret < 0) {
+		return ret;
+	}
+
+	val = sample;
+
+	ret = adc_raw_to_millivolts_dt(&battery, &val);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*mv = val < 0 ? 0 : val;
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+static void parent_link_read(int8_t *rssi, uint8_t *link_quality)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otRouterInfo parent;
+
+	*rssi = 0;
+	*link_quality = 0;
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (otThreadGetParentAverageRssi(ot_context->instance, rssi) != OT_ERROR_NONE) {
+		LOG_WRN("Could not get parent rssi");
+	}
+
+	if (otThreadGetParentInfo(ot_context->instance, &parent) == OT_ERROR_NONE) {
+		*link_quality = parent.mLinkQualityIn;
+	} else {
+		LOG_WRN("Could not get parent info");
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+}
+
+int telemetry_encode(uint8_t *buf, size_t size, size_t *len)
+{
+	struct door_request_stats stats;
+	uint32_t battery_mv = 0;
+	int8_t rssi;
+	uint8_t link_quality;
+	bool ok;
+	int ret;
+
+	ret = battery_read_mv(&battery_mv);
+	if (ret < 0) {
+		LOG_WRN("Could not read battery, err %d", ret);
+	}
+
+	parent_link_read(&rssi, &link_quality);
+	door_request_get_stats(&stats);
+
+	LOG_INF("🔋 battery: %u mV rssi: %d link quality: %u", battery_mv, rssi, link_quality);
+
+	ZCBOR_STATE_E(state, 1, buf, size, 1);
+
+	ok = zcbor_map_start_encode(state, TELEMETRY_KEY_COUNT) &&
+	     zcbor_uint32_put(state, TELEMETRY_BATTERY_MV) &&
+	     zcbor_uint32_put(state, battery_mv) &&
+	     zcbor_uint32_put(state, TELEMETRY_PARENT_RSSI) &&
+	     zcbor_int32_put(state, rssi) &&
+	     zcbor_uint32_put(state, TELEMETRY_PARENT_LINK_QUALITY) &&
+	     zcbor_uint32_put(state, link_quality) &&
+	     zcbor_uint32_put(state, TELEMETRY_RETRANSMITS) &&
+	     zcbor_uint32_put(state, stats.retransmits) &&
+	     zcbor_uint32_put(state, TELEMETRY_LATENCY_US) &&
+	     zcbor_uint32_put(state, stats.latency_us) &&
+	     zcbor_map_end_encode(state, TELEMETRY_KEY_COUNT);
+	if (!ok) {
+		LOG_ERR("Could not encode telemetry");
+		return -ENOMEM;
+	}
+
+	*len = state->payload - buf;
+
+	return 0;
+}
+
+int telemetry_init(void)
+{
+#if defined(HAS_BATTERY)
+	int ret;
+
+	if (!adc_is_ready_dt(&battery)) {
+		return -EIO;
+	}
+
+	ret = adc_channel_setup_dt(&battery);
+	if (ret < 0) {
+		return ret;
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <telemetry_keys.h>
+
+int telemetry_init(void);
+int telemetry_encode(uint8_t *buf, size_t size, size_t *len);
+
+#endif /* TELEMETRY_H_ */
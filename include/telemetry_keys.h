@@ -0,0 +1,19 @@
+#ifndef TELEMETRY_KEYS_H_
+#define TELEMETRY_KEYS_H_
+
+/* CBOR map keys of the telemetry piggybacked on door commands */
+enum telemetry_key {
+	TELEMETRY_BATTERY_MV = 0,
+	TELEMETRY_PARENT_RSSI = 1,
+	/* Thread link quality 0-3 (mLinkQualityIn), not an 802.15.4 LQI */
+	TELEMETRY_PARENT_LINK_QUALITY = 2,
+	TELEMETRY_RETRANSMITS = 3,
+	TELEMETRY_LATENCY_US = 4,
+	/* Server side aggregates, served on /telemetry */
+	TELEMETRY_MIN_BATTERY_MV = 5,
+	TELEMETRY_REPORTS = 6,
+	TELEMETRY_AGE_SEC = 7,
+	TELEMETRY_CLIENT_IID = 8,
+};
+
+#endif /* TELEMETRY_KEYS_H_ */
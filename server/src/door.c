@@ -6,6 +6,12 @@
 LOG_MODULE_REGISTER(door_coap_service, LOG_LEVEL_DBG);
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "relay.h"
+#include "telemetry.h"
+
+#define REQUEST_TIMEOUT K_MSEC(CONFIG_COAP_INIT_ACK_TIMEOUT_MS * 3)
 
 struct request {
 	struct sockaddr addr;
@@ -13,24 +19,68 @@ struct request {
 	k_timepoint_t timeout;
 };
 
-static struct request m_requests[CONFIG_COAP_SERVICE_PENDING_MESSAGES];
+static struct request m_requests[CONFIG_APP_DOOR_REQUEST_CACHE_SIZE];
 
 static const struct gpio_dt_spec door_led = GPIO_DT_SPEC_GET(DT_ALIAS(led2), gpios);
 
-static int get_free_request(struct request **request)
+static struct request *get_free_request(void)
 {
+	struct request *oldest = &m_requests[0];
 	int i;
 
 	for (i = 0; i < ARRAY_SIZE(m_requests); i++) {
 		if (sys_timepoint_expired(m_requests[i].timeout)) {
 			LOG_DBG("found a free request at index = %d", i);
-			*request = &m_requests[i];
-			return 0;
+			return &m_requests[i];
+		}
+
+		if (sys_timepoint_cmp(m_requests[i].timeout, oldest->timeout) < 0) {
+			oldest = &m_requests[i];
 		}
 	}
 
-	LOG_ERR("no free requests");
-	return -ENOMEM;
+	/*
+	 * Never fail, a request that is not remembered would be served again
+	 * on retransmission. The entry closest to expiry is the least likely
+	 * to see one.
+	 */
+	LOG_WRN("no free requests, evicting index = %d", oldest - m_requests);
+	return oldest;
+}
+
+static int get_door_id(struct coap_packet *request, uint8_t *door_id)
+{
+	struct coap_option options[4];
+	unsigned long value;
+	char query[sizeof("id=255")];
+	char *end;
+	int count;
+	int i;
+
+	count = coap_find_options(request, COAP_OPTION_URI_QUERY, options, ARRAY_SIZE(options));
+	if (count < 0) {
+		return count;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (options[i].len <= 3 || options[i].len >= sizeof(query) ||
+		    memcmp(options[i].value, "id=", 3) != 0) {
+			continue;
+		}
+
+		memcpy(query, options[i].value, options[i].len);
+		query[options[i].len] = '\0';
+
+		value = strtoul(&query[3], &end, 10);
+		if (*end != '\0' || value > UINT8_MAX) {
+			return -EINVAL;
+		}
+
+		*door_id = value;
+		return 0;
+	}
+
+	return -ENOENT;
 }
 
 static bool is_request_answered(struct sockaddr *addr, uint16_t id)
@@ -50,6 +100,12 @@ static bool is_request_answered(struct sockaddr *addr, uint16_t id)
 			continue;
 		}
 
+		/*
+		 * Refresh in place, retransmissions back off so the next one
+		 * may come later than the original timeout.
+		 */
+		m_requests[i].timeout = sys_timepoint_calc(REQUEST_TIMEOUT);
+
 		LOG_DBG("request already answered at index = %d", i);
 		return true;
 	}
@@ -58,23 +114,15 @@ static bool is_request_answered(struct sockaddr *addr, uint16_t id)
 	return false;
 }
 
-static int set_request_answered(struct sockaddr *addr, uint16_t id)
+static void set_request_answered(struct sockaddr *addr, uint16_t id)
 {
-	int ret;
-	struct request *request = NULL;
-
-	ret = get_free_request(&request);
-	if (ret < 0) {
-		return ret;
-	}
+	struct request *request = get_free_request();
 
 	net_ipaddr_copy(&request->addr, addr);
 	request->id = id;
-	request->timeout = sys_timepoint_calc(K_MSEC(CONFIG_COAP_INIT_ACK_TIMEOUT_MS * 3));
+	request->timeout = sys_timepoint_calc(REQUEST_TIMEOUT);
 
 	LOG_DBG("request answered set");
-
-	return 0;
 }
 
 static int door_get(struct coap_resource *resource, struct coap_packet *request,
@@ -98,19 +146,18 @@ static int door_get(struct coap_resource *resource, struct coap_packet *request,
 	LOG_INF("📬 GET (door)");
 	LOG_INF("└── type: %u code %u id %u", type, code, id);
 
-	if (is_request_answered(addr, id)) {
-		LOG_INF("↩️  request already answered, skipping");
-		return 0;
-	}
-
+	/*
+	 * GET is idempotent, duplicates are answered again rather than
+	 * remembered so they never evict a POST from the request cache.
+	 */
 	if (type == COAP_TYPE_CON) {
 		type = COAP_TYPE_ACK;
 	} else {
 		type = COAP_TYPE_NON_CON;
 	}
 
-	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1, type, token_length,
-			     token, COAP_RESPONSE_CODE_CONTENT, id);
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1,
+			       type, token_length, token, COAP_RESPONSE_CODE_CONTENT, id);
 	if (ret < 0) {
 		return ret;
 	}
@@ -141,11 +188,6 @@ static int door_get(struct coap_resource *resource, struct coap_packet *request,
 		return ret;
 	}
 
-	ret = set_request_answered(addr, id);
-	if (ret < 0) {
-		LOG_ERR("could not set request as answered");
-	}
-
 	return 0;
 }
 
@@ -157,9 +199,11 @@ static int door_post(struct coap_resource *resource, struct coap_packet *request
 	uint8_t token[COAP_TOKEN_MAX_LEN];
 	const uint8_t *payload;
 	uint16_t payload_len;
+	uint8_t response_code;
 	uint8_t code;
 	uint8_t type;
 	uint8_t token_length;
+	uint8_t door_id;
 	uint16_t id;
 	int ret;
 
@@ -171,48 +215,305 @@ static int door_post(struct coap_resource *resource, struct coap_packet *request
 	LOG_INF("📬 POST (door)");
 	LOG_INF("└── type: %u code %u id %u", type, code, id);
 
-	if (!is_request_answered(addr, id)) {
+	response_code = COAP_RESPONSE_CODE_CHANGED;
+
+	ret = get_door_id(request, &door_id);
+	if (ret == 0 && door_id != CONFIG_APP_DOOR_ID) {
+		/*
+		 * Multicast requests are Non-confirmable, only the target door
+		 * answers those. A CON request is unicast, its sender needs an
+		 * answer or it retransmits until it times out.
+		 */
+		if (type != COAP_TYPE_CON) {
+			LOG_INF("↪️  request for door %u, skipping", door_id);
+			return 0;
+		}
+
+		LOG_WRN("unicast request for door %u", door_id);
+		response_code = COAP_RESPONSE_CODE_NOT_FOUND;
+	} else if (ret < 0 && ret != -ENOENT) {
+		LOG_ERR("invalid door id in request");
+		response_code = COAP_RESPONSE_CODE_BAD_REQUEST;
+	} else if (!is_request_answered(addr, id)) {
 		LOG_INF("🧪  serving request");
 
+		/*
+		 * Remember the request before acting on it so a retransmission
+		 * never toggles twice, even if the response fails to go out.
+		 */
+		set_request_answered(addr, id);
+
 		ret = gpio_pin_toggle_dt(&door_led);
 		if (ret < 0) {
 			LOG_ERR("Could not toggle door led");
 		}
+
+		payload = coap_packet_get_payload(request, &payload_len);
+		if (payload && telemetry_update(addr, payload, payload_len) < 0) {
+			LOG_HEXDUMP_INF(payload, payload_len, "POST Payload");
+		}
 	}
 	else {
 		LOG_INF("ℹ️  request already answered");
 	}
 
-	payload = coap_packet_get_payload(request, &payload_len);
-	if (payload) {
-		LOG_HEXDUMP_INF(payload, payload_len, "POST Payload");
+	if (type == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_NON_CON;
 	}
 
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1,
+			       type, token_length, token, response_code, id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_resource_send(resource, &response, addr, addr_len, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Header, token, Content-Format option and payload marker */
+#define TELEMETRY_RESPONSE_OVERHEAD	(4 + COAP_TOKEN_MAX_LEN + 2 + 1)
+
+BUILD_ASSERT(TELEMETRY_RESPONSE_OVERHEAD + TELEMETRY_MAX_SIZE <= CONFIG_COAP_SERVER_MESSAGE_SIZE,
+	     "CONFIG_APP_TELEMETRY_CLIENT_COUNT too large for CONFIG_COAP_SERVER_MESSAGE_SIZE");
+
+static int telemetry_get(struct coap_resource *resource, struct coap_packet *request,
+			 struct sockaddr *addr, socklen_t addr_len)
+{
+	uint8_t data[CONFIG_COAP_SERVER_MESSAGE_SIZE];
+	struct coap_packet response;
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t token_length;
+	uint8_t type;
+	uint16_t id;
+	size_t len;
+	int ret;
+
+	type = coap_header_get_type(request);
+	id = coap_header_get_id(request);
+	token_length = coap_header_get_token(request, token);
+
+	LOG_INF("📬 GET (telemetry)");
+
 	if (type == COAP_TYPE_CON) {
 		type = COAP_TYPE_ACK;
 	} else {
 		type = COAP_TYPE_NON_CON;
 	}
 
-	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1, type, token_length,
-			       token, COAP_RESPONSE_CODE_CHANGED, id);
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1,
+			       type, token_length, token, COAP_RESPONSE_CODE_CONTENT, id);
 	if (ret < 0) {
 		return ret;
 	}
 
+	ret = coap_append_option_int(&response, COAP_OPTION_CONTENT_FORMAT,
+				     COAP_CONTENT_FORMAT_APP_CBOR);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_payload_marker(&response);
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Encode the table in place, right after the payload marker */
+	ret = telemetry_encode(response.data + response.offset,
+			       response.max_len - response.offset, &len);
+	if (ret < 0) {
+		LOG_ERR("Could not encode telemetry, err %d", ret);
+
+		ret = coap_packet_init(&response, data, sizeof(data),
+				       COAP_VERSION_1, type, token_length, token,
+				       COAP_RESPONSE_CODE_INTERNAL_ERROR, id);
+		if (ret < 0) {
+			return ret;
+		}
+	} else {
+		response.offset += len;
+	}
+
 	ret = coap_resource_send(resource, &response, addr, addr_len, NULL);
 	if (ret < 0) {
 		return ret;
 	}
 
-	ret = set_request_answered(addr, id);
+	return 0;
+}
+
+#if defined(CONFIG_APP_RELAY)
+static void on_relay_done(void);
+
+/* Header, token, Observe, Content-Format, payload marker and status text */
+#define RELAY_STATUS_SIZE	(4 + COAP_TOKEN_MAX_LEN + 4 + 2 + 1 + RELAY_STATUS_TEXT_SIZE)
+#define RELAY_STATUS_TEXT_SIZE	96
+
+static int send_relay_status(struct coap_resource *resource, const struct sockaddr *addr,
+			     socklen_t addr_len, bool observe, uint16_t id,
+			     const uint8_t *token, uint8_t token_length, bool is_response)
+{
+	uint8_t data[RELAY_STATUS_SIZE];
+	struct coap_packet response;
+	struct relay_stats stats;
+	uint8_t payload[RELAY_STATUS_TEXT_SIZE];
+	uint8_t type;
+	int ret;
+
+	if (is_response) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_CON;
+		id = coap_next_id();
+	}
+
+	relay_get_stats(&stats);
+
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1,
+			       type, token_length, token, COAP_RESPONSE_CODE_CONTENT, id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (observe) {
+		ret = coap_append_option_int(&response, COAP_OPTION_OBSERVE, resource->age);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = coap_append_option_int(&response, COAP_OPTION_CONTENT_FORMAT,
+				     COAP_CONTENT_FORMAT_TEXT_PLAIN);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_payload_marker(&response);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = snprintf(payload, sizeof(payload),
+		       "Door: %u\nResult: %d\nLatency: %u\nQueued: %u\nMax: %u\n"
+		       "OK: %u\nFailed: %u\n",
+		       stats.last_door_id, stats.last_result, stats.last_latency_ms,
+		       stats.queued, stats.max_queued, stats.forwarded, stats.failed);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_payload(&response, payload, strlen(payload));
+	if (ret < 0) {
+		return ret;
+	}
+
+	return coap_resource_send(resource, &response, addr, addr_len, NULL);
+}
+
+static int relay_get(struct coap_resource *resource, struct coap_packet *request,
+		     struct sockaddr *addr, socklen_t addr_len)
+{
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t token_length;
+	uint16_t id;
+	bool observe;
+	int ret;
+
+	id = coap_header_get_id(request);
+	token_length = coap_header_get_token(request, token);
+
+	LOG_INF("📬 GET (relay)");
+
+	observe = coap_resource_parse_observe(resource, request, addr) == 0;
+
+	ret = send_relay_status(resource, addr, addr_len, observe, id, token, token_length,
+				true);
 	if (ret < 0) {
-		LOG_ERR("could not set request as answered");
+		return ret;
 	}
 
 	return 0;
 }
 
+static void relay_notify(struct coap_resource *resource, struct coap_observer *observer)
+{
+	int ret;
+
+	ret = send_relay_status(resource, &observer->addr, sizeof(observer->addr), true, 0,
+				observer->token, observer->tkl, false);
+	if (ret < 0) {
+		LOG_ERR("Could not notify relay observer");
+	}
+}
+
+static int relay_post(struct coap_resource *resource, struct coap_packet *request,
+		      struct sockaddr *addr, socklen_t addr_len)
+{
+	uint8_t data[CONFIG_COAP_SERVER_MESSAGE_SIZE];
+	struct coap_packet response;
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t response_code;
+	uint8_t code;
+	uint8_t type;
+	uint8_t token_length;
+	uint8_t door_id;
+	uint16_t id;
+	int ret;
+
+	code = coap_header_get_code(request);
+	type = coap_header_get_type(request);
+	id = coap_header_get_id(request);
+	token_length = coap_header_get_token(request, token);
+
+	LOG_INF("📬 POST (relay)");
+	LOG_INF("└── type: %u code %u id %u", type, code, id);
+
+	response_code = COAP_RESPONSE_CODE_CHANGED;
+
+	if (!is_request_answered(addr, id)) {
+		ret = get_door_id(request, &door_id);
+		if (ret < 0) {
+			LOG_ERR("no valid door id in relay request");
+			response_code = COAP_RESPONSE_CODE_BAD_REQUEST;
+		} else if (door_id == CONFIG_APP_DOOR_ID) {
+			LOG_ERR("refusing to relay to own door %u", door_id);
+			response_code = COAP_RESPONSE_CODE_BAD_REQUEST;
+		} else if (relay_enqueue(door_id) < 0) {
+			response_code = COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE;
+		} else {
+			set_request_answered(addr, id);
+		}
+	} else {
+		LOG_INF("ℹ️  request already answered");
+	}
+
+	if (type == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_NON_CON;
+	}
+
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1,
+			       type, token_length, token, response_code, id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_resource_send(resource, &response, addr, addr_len, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return 0;
+}
+#endif /* CONFIG_APP_RELAY */
+
 int door_init(void)
 {
 	int ret;
@@ -226,6 +527,13 @@ int door_init(void)
 		return ret;
 	}
 
+#if defined(CONFIG_APP_RELAY)
+	ret = relay_init(on_relay_done);
+	if (ret < 0) {
+		return ret;
+	}
+#endif
+
 	return 0;
 }
 
@@ -236,3 +544,37 @@ COAP_RESOURCE_DEFINE(door, coap_server,
 			     .post = door_post,
 			     .path = door_path,
 		     });
+
+static const char *const telemetry_path[] = {"telemetry", NULL};
+COAP_RESOURCE_DEFINE(telemetry, coap_server,
+		     {
+			     .get = telemetry_get,
+			     .path = telemetry_path,
+		     });
+
+#if defined(CONFIG_APP_RELAY)
+static const char *const relay_path[] = {"relay", NULL};
+COAP_RESOURCE_DEFINE(relay, coap_server,
+		     {
+			     .get = relay_get,
+			     .post = relay_post,
+			     .notify = relay_notify,
+			     .path = relay_path,
+		     });
+
+static void relay_notify_work_handler(struct k_work *work)
+{
+	coap_resource_notify(&relay);
+}
+
+static K_WORK_DEFINE(relay_notify_work, relay_notify_work_handler);
+
+/*
+ * Called from the relay thread, keep the notification and its network
+ * send off that stack.
+ */
+static void on_relay_done(void)
+{
+	k_work_submit(&relay_notify_work);
+}
+#endif
@@ -0,0 +1,299 @@
+#include <zephyr/dfu/flash_img.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/coap_service.h>
+#include <zephyr/sys/reboot.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(fw_coap_service, LOG_LEVEL_DBG);
+
+#include "fw.h"
+
+#define FW_RESPONSE_SIZE	32
+
+#define BLOCK1_NUM(v)		((v) >> 4)
+#define BLOCK1_MORE(v)		(((v) & 0x08) != 0)
+#define BLOCK1_SZX(v)		((v) & 0x07)
+#define BLOCK1_VALUE(num, more, szx) \
+	(((num) << 4) | ((more) ? 0x08 : 0) | (szx))
+#define SZX_TO_BYTES(szx)	(1 << ((szx) + 4))
+
+struct transfer {
+	struct flash_img_context flash_ctx;
+	struct sockaddr addr;
+	size_t offset;
+	int64_t started_at;
+	k_timepoint_t timeout;
+	uint32_t last_block;
+	bool in_progress;
+	bool finished;
+};
+
+static struct transfer m_transfer;
+
+static void reboot_work_handler(struct k_work *work)
+{
+	LOG_INF("🔄 rebooting into new image");
+	sys_reboot(SYS_REBOOT_WARM);
+}
+
+static K_WORK_DELAYABLE_DEFINE(reboot_work, reboot_work_handler);
+
+static bool is_allowed_peer(const struct sockaddr *addr)
+{
+	struct in6_addr allowed;
+
+	if (net_addr_pton(AF_INET6, CONFIG_APP_FW_ALLOWED_PEER, &allowed) < 0) {
+		return false;
+	}
+
+	return net_ipv6_addr_cmp(&net_sin6(addr)->sin6_addr, &allowed);
+}
+
+static bool is_same_peer(const struct sockaddr *addr)
+{
+	const struct sockaddr_in6 *a6 = net_sin6(addr);
+	const struct sockaddr_in6 *b6 = net_sin6(&m_transfer.addr);
+
+	return a6->sin6_port == b6->sin6_port &&
+	       net_ipv6_addr_cmp(&a6->sin6_addr, &b6->sin6_addr);
+}
+
+static int send_response(struct coap_resource *resource, struct coap_packet *request,
+			 struct sockaddr *addr, socklen_t addr_len, uint8_t code, int block1)
+{
+	uint8_t data[FW_RESPONSE_SIZE];
+	struct coap_packet response;
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t token_length;
+	uint8_t type;
+	uint16_t id;
+	int ret;
+
+	type = coap_header_get_type(request);
+	id = coap_header_get_id(request);
+	token_length = coap_header_get_token(request, token);
+
+	if (type == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_NON_CON;
+	}
+
+	ret = coap_packet_init(&response, data, sizeof(data), COAP_VERSION_1, type, token_length,
+			       token, code, id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (block1 >= 0) {
+		ret = coap_append_option_int(&response, COAP_OPTION_BLOCK1, block1);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = coap_resource_send(resource, &response, addr, addr_len, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return 0;
+}
+
+static int transfer_start(struct sockaddr *addr)
+{
+	int ret;
+
+	ret = flash_img_init(&m_transfer.flash_ctx);
+	if (ret < 0) {
+		LOG_ERR("Could not init flash image");
+		return ret;
+	}
+
+	net_ipaddr_copy(&m_transfer.addr, addr);
+	m_transfer.offset = 0;
+	m_transfer.started_at = k_uptime_get();
+	m_transfer.in_progress = true;
+	m_transfer.finished = false;
+
+	LOG_INF("📥 firmware transfer started");
+
+	return 0;
+}
+
+static int transfer_finish(uint32_t last_block)
+{
+	int64_t elapsed;
+	int ret;
+
+	m_transfer.in_progress = false;
+	m_transfer.last_block = last_block;
+
+	elapsed = k_uptime_get() - m_transfer.started_at;
+
+	LOG_INF("📦 firmware received");
+	LOG_INF("├── size: %u bytes", m_transfer.offset);
+	LOG_INF("├── time: %lld ms", elapsed);
+	LOG_INF("└── throughput: %lld B/s", elapsed ? m_transfer.offset * 1000LL / elapsed : 0);
+
+	ret = boot_request_upgrade(BOOT_UPGRADE_TEST);
+	if (ret < 0) {
+		LOG_ERR("Could not request upgrade");
+		return ret;
+	}
+
+	m_transfer.finished = true;
+
+	k_work_schedule(&reboot_work, K_SECONDS(CONFIG_APP_FW_REBOOT_DELAY_SEC));
+
+	return 0;
+}
+
+static int fw_put(struct coap_resource *resource, struct coap_packet *request,
+		  struct sockaddr *addr, socklen_t addr_len)
+{
+	const uint8_t *payload;
+	uint16_t payload_len;
+	size_t offset;
+	bool more;
+	int block1;
+	int ret;
+
+	if (!is_allowed_peer(addr)) {
+		LOG_WRN("firmware update refused from this peer");
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_FORBIDDEN, -1);
+	}
+
+	block1 = coap_get_option_int(request, COAP_OPTION_BLOCK1);
+	if (block1 < 0) {
+		LOG_ERR("firmware must be sent block-wise");
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_BAD_REQUEST, -1);
+	}
+
+	/*
+	 * Blocks larger than CONFIG_APP_FW_BLOCK_SIZE get fragmented by
+	 * 6LoWPAN, ask the client to use ours instead.
+	 */
+	if (SZX_TO_BYTES(BLOCK1_SZX(block1)) > CONFIG_APP_FW_BLOCK_SIZE) {
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_REQUEST_TOO_LARGE,
+				     BLOCK1_VALUE(0, false,
+						  coap_bytes_to_block_size(CONFIG_APP_FW_BLOCK_SIZE)));
+	}
+
+	offset = BLOCK1_NUM(block1) * SZX_TO_BYTES(BLOCK1_SZX(block1));
+	more = BLOCK1_MORE(block1);
+
+	LOG_DBG("📬 PUT (fw) offset %u more %u", offset, more);
+
+	if (m_transfer.in_progress && sys_timepoint_expired(m_transfer.timeout)) {
+		LOG_WRN("firmware transfer timed out");
+		m_transfer.in_progress = false;
+	}
+
+	if (m_transfer.finished) {
+		/* The 2.04 for the last block got lost, answer it again */
+		if (is_same_peer(addr) && !more &&
+		    BLOCK1_NUM(block1) == m_transfer.last_block) {
+			return send_response(resource, request, addr, addr_len,
+					     COAP_RESPONSE_CODE_CHANGED, block1);
+		}
+
+		LOG_WRN("firmware received, reboot pending");
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE, -1);
+	}
+
+	if (offset == 0 && m_transfer.in_progress && !is_same_peer(addr)) {
+		LOG_WRN("firmware transfer in progress from another peer");
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE, -1);
+	}
+
+	if (offset == 0 && !m_transfer.in_progress) {
+		ret = transfer_start(addr);
+		if (ret < 0) {
+			return send_response(resource, request, addr, addr_len,
+					     COAP_RESPONSE_CODE_INTERNAL_ERROR, -1);
+		}
+	}
+
+	if (!m_transfer.in_progress || !is_same_peer(addr) || offset > m_transfer.offset) {
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_INCOMPLETE, -1);
+	}
+
+	m_transfer.timeout = sys_timepoint_calc(K_SECONDS(CONFIG_APP_FW_TIMEOUT_SEC));
+
+	/* Retransmitted block, it is already written */
+	if (offset < m_transfer.offset) {
+		LOG_DBG("block at offset %u already written", offset);
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_CONTINUE, block1);
+	}
+
+	payload = coap_packet_get_payload(request, &payload_len);
+
+	/*
+	 * Offsets are derived from the block number, a block of the wrong
+	 * size would misplace every block after it.
+	 */
+	if (more ? payload_len != SZX_TO_BYTES(BLOCK1_SZX(block1)) :
+		   payload_len > SZX_TO_BYTES(BLOCK1_SZX(block1))) {
+		LOG_ERR("block at offset %u has %u bytes", offset, payload_len);
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_BAD_REQUEST, -1);
+	}
+
+	ret = flash_img_buffered_write(&m_transfer.flash_ctx, payload, payload_len, !more);
+	if (ret < 0) {
+		LOG_ERR("Could not write firmware block at offset %u", offset);
+		m_transfer.in_progress = false;
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_INTERNAL_ERROR, -1);
+	}
+
+	m_transfer.offset += payload_len;
+
+	if (more) {
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_CONTINUE, block1);
+	}
+
+	ret = transfer_finish(BLOCK1_NUM(block1));
+	if (ret < 0) {
+		return send_response(resource, request, addr, addr_len,
+				     COAP_RESPONSE_CODE_INTERNAL_ERROR, -1);
+	}
+
+	return send_response(resource, request, addr, addr_len, COAP_RESPONSE_CODE_CHANGED,
+			     block1);
+}
+
+int fw_confirm_image(void)
+{
+	int ret;
+
+	if (boot_is_img_confirmed()) {
+		return 0;
+	}
+
+	ret = boot_write_img_confirmed();
+	if (ret < 0) {
+		return ret;
+	}
+
+	LOG_INF("✅ firmware image confirmed");
+
+	return 0;
+}
+
+static const char *const fw_path[] = {"fw", NULL};
+COAP_RESOURCE_DEFINE(fw, coap_server,
+		     {
+			     .put = fw_put,
+			     .path = fw_path,
+		     });
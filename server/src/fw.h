@@ -0,0 +1,6 @@
+#ifndef FW_H_
+#define FW_H_
+
+int fw_confirm_image(void);
+
+#endif /* FW_H_ */
@@ -21,6 +21,7 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
 #include <mymodule/base/watchdog.h>
 
 #include "door.h"
+#include "fw.h"
 
 #define BUTTON_PRESS_EVENT		BIT(0)
 #define MANUAL_REBOOT_TOKEN		(uint8_t)0x38
@@ -67,15 +68,18 @@ int join_coap_multicast_group(void)
 
 int main(void)
 {
+#if defined(CONFIG_MY_MODULE_BASE_WATCHDOG)
 	const struct device *wdt = DEVICE_DT_GET(DT_NODELABEL(wdt0));
+#endif
 #if defined(CONFIG_APP_SUSPEND_CONSOLE)
 	const struct device *cons = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
 #endif
 	int ret;
-	uint32_t reset_cause;
-	int main_wdt_chan_id = -1;
+	uint32_t reset_cause __maybe_unused;
+	int main_wdt_chan_id __maybe_unused = -1;
 	uint32_t events;
 
+#if defined(CONFIG_MY_MODULE_BASE_WATCHDOG)
 	ret = watchdog_new_channel(wdt, &main_wdt_chan_id);
 	if (ret < 0) {
 		LOG_ERR("Could allocate main watchdog channel");
@@ -87,9 +91,11 @@ int main(void)
 		LOG_ERR("Could allocate start watchdog");
 		return ret;
 	}
+#endif
 
 	LOG_INF("\n\n🚀 MAIN START (%s) 🚀\n", APP_VERSION_FULL);
 
+#if defined(CONFIG_MY_MODULE_BASE_RESET)
 	reset_cause = show_and_clear_reset_cause();
 
 	if (is_reset_cause_watchdog(reset_cause)
@@ -103,6 +109,7 @@ int main(void)
 			sys_reboot(MANUAL_REBOOT_TOKEN);
 		}
 	}
+#endif
 
 	if (!gpio_is_ready_dt(&power_led)) {
 		return -EIO;
@@ -128,6 +135,7 @@ int main(void)
 		module_set_state(MODULE_STATE_READY);
 	}
 
+#if defined(CONFIG_MY_MODULE_BASE_OPENTHREAD)
 	ret = openthread_my_start();
 	if (ret < 0) {
 		LOG_ERR("Could not start openthread");
@@ -136,6 +144,7 @@ int main(void)
 
 	LOG_INF("💤 waiting for openthread to be ready");
 	openthread_wait(OT_ROLE_SET | OT_MESH_LOCAL_ADDR_SET);
+#endif
 
 	ret = join_coap_multicast_group();
 	if (ret < 0) {
@@ -155,6 +164,14 @@ int main(void)
 		return ret;
 	}
 
+#if defined(CONFIG_MCUBOOT_IMG_MANAGER)
+	ret = fw_confirm_image();
+	if (ret < 0) {
+		LOG_ERR("Could not confirm firmware image");
+		return ret;
+	}
+#endif
+
 	ret = gpio_pin_set_dt(&initialized_led, 1);
 	if (ret < 0) {
 		LOG_ERR("Could not set initialized led");
@@ -187,8 +204,10 @@ int main(void)
 			LOG_INF("handling button press event");
 		}
 
+#if defined(CONFIG_MY_MODULE_BASE_WATCHDOG)
 		LOG_INF("🦴 feed watchdog");
 		wdt_feed(wdt, main_wdt_chan_id);
+#endif
 	}
 
 	return 0;
@@ -0,0 +1,257 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(relay, LOG_LEVEL_DBG);
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "relay.h"
+
+#define ALL_FTD_MCAST \
+        { { { 0xff, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02 } } }
+#define COAP_PORT	5683
+#define COAP_PATH	"door"
+#define MESSAGE_SIZE	64
+
+struct relay_command {
+	int64_t enqueued_at;
+	uint8_t door_id;
+};
+
+K_MSGQ_DEFINE(relay_msgq, sizeof(struct relay_command), CONFIG_APP_RELAY_QUEUE_DEPTH, 4);
+
+static struct k_spinlock stats_lock;
+static struct relay_stats m_stats;
+static relay_done_cb_t m_done_cb;
+static int m_sockfd = -1;
+
+static struct sockaddr_in6 m_sockaddr6 = {
+	.sin6_family = AF_INET6,
+	.sin6_port = htons(COAP_PORT),
+	.sin6_addr = ALL_FTD_MCAST,
+};
+
+static int encode(uint8_t *buf, size_t size, const struct relay_command *cmd,
+		  const uint8_t *token, uint16_t id)
+{
+	struct coap_packet request;
+	char query[sizeof("id=255")];
+	int ret;
+
+	/* Multicast requests must be Non-confirmable (RFC 7252 8.1) */
+	ret = coap_packet_init(&request, buf, size, COAP_VERSION_1, COAP_TYPE_NON_CON,
+			       COAP_TOKEN_MAX_LEN, token, COAP_METHOD_POST, id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_option(&request, COAP_OPTION_URI_PATH, COAP_PATH,
+					strlen(COAP_PATH));
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = snprintf(query, sizeof(query), "id=%u", cmd->door_id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = coap_packet_append_option(&request, COAP_OPTION_URI_QUERY, query, ret);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return request.offset;
+}
+
+static int wait_response(const uint8_t *token, int timeout_ms)
+{
+	uint8_t buf[MESSAGE_SIZE];
+	uint8_t response_token[COAP_TOKEN_MAX_LEN];
+	struct zsock_pollfd fds = {
+		.fd = m_sockfd,
+		.events = ZSOCK_POLLIN,
+	};
+	struct coap_packet response;
+	k_timepoint_t end = sys_timepoint_calc(K_MSEC(timeout_ms));
+	int ret;
+
+	while (!sys_timepoint_expired(end)) {
+		ret = zsock_poll(&fds, 1, k_ticks_to_ms_ceil32(sys_timepoint_timeout(end).ticks));
+		if (ret < 0) {
+			return -errno;
+		}
+		if (ret == 0) {
+			break;
+		}
+
+		ret = zsock_recv(m_sockfd, buf, sizeof(buf), 0);
+		if (ret < 0) {
+			return -errno;
+		}
+
+		ret = coap_packet_parse(&response, buf, ret, NULL, 0);
+		if (ret < 0) {
+			continue;
+		}
+
+		/* Late answers to an earlier command carry another token */
+		if (coap_header_get_token(&response, response_token) != COAP_TOKEN_MAX_LEN ||
+		    memcmp(response_token, token, COAP_TOKEN_MAX_LEN) != 0) {
+			LOG_DBG("Ignoring response id %u", coap_header_get_id(&response));
+			continue;
+		}
+
+		return coap_header_get_code(&response);
+	}
+
+	return -EAGAIN;
+}
+
+static int forward(const struct relay_command *cmd)
+{
+	uint8_t buf[MESSAGE_SIZE];
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	int retransmits;
+	int len;
+	int ret;
+
+	memcpy(token, coap_next_token(), sizeof(token));
+
+	/*
+	 * Retransmissions reuse the MID so the target door deduplicates
+	 * them. They are spaced by the ACK timeout, well within its dedup
+	 * window.
+	 */
+	len = encode(buf, sizeof(buf), cmd, token, coap_next_id());
+	if (len < 0) {
+		return len;
+	}
+
+	for (retransmits = 0; retransmits <= CONFIG_APP_RELAY_RETRANSMITS; retransmits++) {
+		ret = zsock_sendto(m_sockfd, buf, len, 0, (struct sockaddr *)&m_sockaddr6,
+				   sizeof(m_sockaddr6));
+		if (ret < 0) {
+			LOG_ERR("Failed to send relay request, err %d", errno);
+			return -errno;
+		}
+
+		ret = wait_response(token, CONFIG_COAP_INIT_ACK_TIMEOUT_MS);
+		if (ret != -EAGAIN) {
+			return ret;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static void relay_thread(void *p1, void *p2, void *p3)
+{
+	struct relay_command cmd;
+	k_spinlock_key_t key;
+	int64_t latency;
+	int ret;
+
+	while (1) {
+		k_msgq_get(&relay_msgq, &cmd, K_FOREVER);
+
+		LOG_INF("📤 relaying door %u", cmd.door_id);
+
+		ret = forward(&cmd);
+		latency = k_uptime_get() - cmd.enqueued_at;
+
+		LOG_INF("└── result: %d latency: %lld ms", ret, latency);
+
+		key = k_spin_lock(&stats_lock);
+		if (ret == COAP_RESPONSE_CODE_CHANGED) {
+			m_stats.forwarded++;
+		} else {
+			m_stats.failed++;
+		}
+		m_stats.last_latency_ms = latency;
+		m_stats.last_result = ret;
+		m_stats.last_door_id = cmd.door_id;
+		k_spin_unlock(&stats_lock, key);
+
+		if (m_done_cb) {
+			m_done_cb();
+		}
+	}
+}
+
+K_THREAD_DEFINE(relay_thread_id, CONFIG_APP_RELAY_STACK_SIZE, relay_thread, NULL, NULL, NULL,
+		K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+int relay_enqueue(uint8_t door_id)
+{
+	struct relay_command cmd = {
+		.enqueued_at = k_uptime_get(),
+		.door_id = door_id,
+	};
+	k_spinlock_key_t key;
+	uint32_t queued;
+	int ret;
+
+	if (m_sockfd < 0) {
+		return -EAGAIN;
+	}
+
+	ret = k_msgq_put(&relay_msgq, &cmd, K_NO_WAIT);
+	if (ret < 0) {
+		LOG_ERR("relay queue full");
+		return ret;
+	}
+
+	queued = k_msgq_num_used_get(&relay_msgq);
+
+	key = k_spin_lock(&stats_lock);
+	if (queued > m_stats.max_queued) {
+		m_stats.max_queued = queued;
+	}
+	k_spin_unlock(&stats_lock, key);
+
+	LOG_INF("📥 relay queued for door %u (%u queued)", door_id, queued);
+
+	return 0;
+}
+
+void relay_get_stats(struct relay_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&stats_lock);
+	*stats = m_stats;
+	k_spin_unlock(&stats_lock, key);
+
+	stats->queued = k_msgq_num_used_get(&relay_msgq);
+}
+
+int relay_init(relay_done_cb_t done_cb)
+{
+	int ret;
+	int sockfd;
+	int mcast_hops = 8;
+
+	m_done_cb = done_cb;
+
+	sockfd = zsock_socket(m_sockaddr6.sin6_family, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		LOG_ERR("Failed to create socket, err %d", errno);
+		return -errno;
+	}
+
+	ret = zsock_setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &mcast_hops,
+			       sizeof(mcast_hops));
+	if (ret < 0) {
+		LOG_WRN("Could not set multicast hops, err %d", errno);
+	}
+
+	m_sockfd = sockfd;
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <stdint.h>
+
+struct relay_stats {
+	uint32_t forwarded;
+	uint32_t failed;
+	uint32_t queued;
+	uint32_t max_queued;
+	uint32_t last_latency_ms;
+	int16_t last_result;
+	uint8_t last_door_id;
+};
+
+typedef void (*relay_done_cb_t)(void);
+
+int relay_init(relay_done_cb_t done_cb);
+int relay_enqueue(uint8_t door_id);
+void relay_get_stats(struct relay_stats *stats);
+
+#endif /* RELAY_H_ */
@@ -0,0 +1,200 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_ip.h>
+#include <zcbor_decode.h>
+#include <zcbor_encode.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(telemetry, LOG_LEVEL_DBG);
+
+#include "telemetry.h"
+
+#define CLIENT_KEY_COUNT	9
+#define IID_OFFSET		8
+#define IID_LEN			8
+
+BUILD_ASSERT(TELEMETRY_CLIENT_MAX_SIZE == 2 + CLIENT_KEY_COUNT + 1 + IID_LEN +
+	     (CLIENT_KEY_COUNT - 1) * 5, "TELEMETRY_CLIENT_MAX_SIZE out of date");
+
+struct client_telemetry {
+	struct in6_addr addr;
+	int64_t updated_at;
+	uint32_t reports;
+	uint32_t battery_mv;
+	uint32_t min_battery_mv;
+	int32_t rssi;
+	uint32_t link_quality;
+	uint32_t retransmits;
+	uint32_t latency_us;
+};
+
+static struct client_telemetry m_clients[CONFIG_APP_TELEMETRY_CLIENT_COUNT];
+static K_MUTEX_DEFINE(clients_lock);
+
+static struct client_telemetry *get_client(const struct in6_addr *addr)
+{
+	struct client_telemetry *oldest = &m_clients[0];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(m_clients); i++) {
+		if (m_clients[i].reports && net_ipv6_addr_cmp(&m_clients[i].addr, addr)) {
+			return &m_clients[i];
+		}
+
+		if (m_clients[i].updated_at < oldest->updated_at || !m_clients[i].reports) {
+			oldest = &m_clients[i];
+		}
+	}
+
+	LOG_DBG("new telemetry client at index = %d", oldest - m_clients);
+
+	memset(oldest, 0, sizeof(*oldest));
+	net_ipaddr_copy(&oldest->addr, addr);
+
+	return oldest;
+}
+
+static int decode(const uint8_t *payload, size_t len, struct client_telemetry *t)
+{
+	uint32_t key;
+	bool ok;
+
+	ZCBOR_STATE_D(state, 1, payload, len, 1, 0);
+
+	if (!zcbor_map_start_decode(state)) {
+		return -EBADMSG;
+	}
+
+	while (!zcbor_array_at_end(state)) {
+		if (!zcbor_uint32_decode(state, &key)) {
+			return -EBADMSG;
+		}
+
+		switch (key) {
+		case TELEMETRY_BATTERY_MV:
+			ok = zcbor_uint32_decode(state, &t->battery_mv);
+			break;
+		case TELEMETRY_PARENT_RSSI:
+			ok = zcbor_int32_decode(state, &t->rssi);
+			break;
+		case TELEMETRY_PARENT_LINK_QUALITY:
+			ok = zcbor_uint32_decode(state, &t->link_quality);
+			break;
+		case TELEMETRY_RETRANSMITS:
+			ok = zcbor_uint32_decode(state, &t->retransmits);
+			break;
+		case TELEMETRY_LATENCY_US:
+			ok = zcbor_uint32_decode(state, &t->latency_us);
+			break;
+		default:
+			ok = zcbor_any_skip(state, NULL);
+			break;
+		}
+
+		if (!ok) {
+			return -EBADMSG;
+		}
+	}
+
+	if (!zcbor_map_end_decode(state)) {
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+int telemetry_update(const struct sockaddr *addr, const uint8_t *payload, size_t len)
+{
+	struct client_telemetry decoded = {0};
+	struct client_telemetry *client;
+	int ret;
+
+	ret = decode(payload, len, &decoded);
+	if (ret < 0) {
+		LOG_WRN("invalid telemetry");
+		return ret;
+	}
+
+	LOG_INF("🔋 battery: %u mV rssi: %d link quality: %u rtx: %u latency: %u us",
+		decoded.battery_mv, decoded.rssi, decoded.link_quality, decoded.retransmits,
+		decoded.latency_us);
+
+	k_mutex_lock(&clients_lock, K_FOREVER);
+
+	client = get_client(&net_sin6(addr)->sin6_addr);
+
+	if (decoded.battery_mv &&
+	    (!client->min_battery_mv || decoded.battery_mv < client->min_battery_mv)) {
+		client->min_battery_mv = decoded.battery_mv;
+	}
+
+	client->battery_mv = decoded.battery_mv;
+	client->rssi = decoded.rssi;
+	client->link_quality = decoded.link_quality;
+	client->retransmits = decoded.retransmits;
+	client->latency_us = decoded.latency_us;
+	client->reports++;
+	client->updated_at = k_uptime_get();
+
+	k_mutex_unlock(&clients_lock);
+
+	return 0;
+}
+
+static bool encode_client(zcbor_state_t *state, const struct client_telemetry *t)
+{
+	uint32_t age = (k_uptime_get() - t->updated_at) / MSEC_PER_SEC;
+
+	return zcbor_map_start_encode(state, CLIENT_KEY_COUNT) &&
+	       zcbor_uint32_put(state, TELEMETRY_CLIENT_IID) &&
+	       zcbor_bstr_encode_ptr(state, &t->addr.s6_addr[IID_OFFSET], IID_LEN) &&
+	       zcbor_uint32_put(state, TELEMETRY_BATTERY_MV) &&
+	       zcbor_uint32_put(state, t->battery_mv) &&
+	       zcbor_uint32_put(state, TELEMETRY_MIN_BATTERY_MV) &&
+	       zcbor_uint32_put(state, t->min_battery_mv) &&
+	       zcbor_uint32_put(state, TELEMETRY_PARENT_RSSI) &&
+	       zcbor_int32_put(state, t->rssi) &&
+	       zcbor_uint32_put(state, TELEMETRY_PARENT_LINK_QUALITY) &&
+	       zcbor_uint32_put(state, t->link_quality) &&
+	       zcbor_uint32_put(state, TELEMETRY_RETRANSMITS) &&
+	       zcbor_uint32_put(state, t->retransmits) &&
+	       zcbor_uint32_put(state, TELEMETRY_LATENCY_US) &&
+	       zcbor_uint32_put(state, t->latency_us) &&
+	       zcbor_uint32_put(state, TELEMETRY_REPORTS) &&
+	       zcbor_uint32_put(state, t->reports) &&
+	       zcbor_uint32_put(state, TELEMETRY_AGE_SEC) &&
+	       zcbor_uint32_put(state, age) &&
+	       zcbor_map_end_encode(state, CLIENT_KEY_COUNT);
+}
+
+int telemetry_encode(uint8_t *buf, size_t size, size_t *len)
+{
+	bool ok;
+	int i;
+
+	ZCBOR_STATE_E(state, 1, buf, size, 1);
+
+	k_mutex_lock(&clients_lock, K_FOREVER);
+
+	ok = zcbor_list_start_encode(state, ARRAY_SIZE(m_clients));
+
+	for (i = 0; ok && i < ARRAY_SIZE(m_clients); i++) {
+		if (!m_clients[i].reports) {
+			continue;
+		}
+
+		ok = encode_client(state, &m_clients[i]);
+	}
+
+	ok = ok && zcbor_list_end_encode(state, ARRAY_SIZE(m_clients));
+
+	k_mutex_unlock(&clients_lock);
+
+	if (!ok) {
+		LOG_ERR("Could not encode telemetry table");
+		return -ENOMEM;
+	}
+
+	*len = state->payload - buf;
+
+	return 0;
+}
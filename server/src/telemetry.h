@@ -0,0 +1,22 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/net/net_ip.h>
+
+#include <telemetry_keys.h>
+
+/*
+ * Worst case encoded size of one /telemetry client entry: map start and
+ * end, 9 one byte keys, the IID byte string and 8 integers of up to 5
+ * bytes. The table adds a list start and end.
+ */
+#define TELEMETRY_CLIENT_MAX_SIZE	(2 + 9 + (1 + 8) + 8 * 5)
+#define TELEMETRY_MAX_SIZE \
+	(2 + CONFIG_APP_TELEMETRY_CLIENT_COUNT * TELEMETRY_CLIENT_MAX_SIZE)
+
+int telemetry_update(const struct sockaddr *addr, const uint8_t *payload, size_t len);
+int telemetry_encode(uint8_t *buf, size_t size, size_t *len);
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,426 @@
+/*
+ * Door request dedup under randomized load.
+ *
+ * The door handlers are called directly with requests built here. Their
+ * responses are captured by wrapping coap_resource_send() and the dedup
+ * timeouts run on a simulated clock by wrapping the timepoint helpers.
+ * Every actuation is observed on the emulated door pin and counted per
+ * (address, MID), each unique command must actuate exactly once.
+ */
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/coap_service.h>
+#include <zephyr/ztest.h>
+
+#include <stdio.h>
+
+#include "door.h"
+
+#define ITERATIONS	2000000
+#define PEER_COUNT	8
+#define CACHE_SIZE	CONFIG_APP_DOOR_REQUEST_CACHE_SIZE
+#define SEED		0x2545f491
+
+struct command {
+	uint8_t peer;
+	uint16_t mid;
+	uint8_t type;
+	uint64_t expiry;
+	bool live;
+};
+
+extern struct coap_resource door;
+
+uint64_t host_clock_us(void);
+
+static const struct gpio_dt_spec door_led = GPIO_DT_SPEC_GET(DT_ALIAS(led2), gpios);
+
+static uint64_t sim_ticks;
+static uint64_t window_ticks;
+static uint32_t rng_state;
+
+static uint32_t sent;
+static uint8_t last_code;
+
+static uint8_t actuations[PEER_COUNT][UINT16_MAX + 1];
+static uint16_t next_mid[PEER_COUNT];
+static struct command commands[CACHE_SIZE];
+
+k_timepoint_t __wrap_sys_timepoint_calc(k_timeout_t timeout)
+{
+	k_timepoint_t timepoint;
+
+	if (K_TIMEOUT_EQ(timeout, K_FOREVER)) {
+		timepoint.tick = UINT64_MAX;
+	} else if (K_TIMEOUT_EQ(timeout, K_NO_WAIT)) {
+		timepoint.tick = 0;
+	} else {
+		timepoint.tick = sim_ticks + timeout.ticks;
+	}
+
+	return timepoint;
+}
+
+k_timeout_t __wrap_sys_timepoint_timeout(k_timepoint_t timepoint)
+{
+	if (timepoint.tick == UINT64_MAX) {
+		return K_FOREVER;
+	}
+
+	if (timepoint.tick <= sim_ticks) {
+		return K_NO_WAIT;
+	}
+
+	return K_TICKS(timepoint.tick - sim_ticks);
+}
+
+int __wrap_coap_resource_send(const struct coap_resource *resource, struct coap_packet *cpkt,
+			      const struct sockaddr *addr, socklen_t addr_len,
+			      const struct coap_transmission_parameters *params)
+{
+	sent++;
+	last_code = coap_header_get_code(cpkt);
+
+	return 0;
+}
+
+static uint32_t rng(void)
+{
+	/* xorshift32, deterministic so a failure can be replayed */
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static void advance(uint64_t ticks)
+{
+	sim_ticks += ticks;
+}
+
+static void peer_addr(uint8_t peer, struct sockaddr_in6 *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin6_family = AF_INET6;
+	addr->sin6_port = htons(5683 + peer % 2);
+	addr->sin6_addr.s6_addr[0] = 0xfd;
+	addr->sin6_addr.s6_addr[15] = peer / 2 + 1;
+}
+
+/* Returns true when the call actuated the door */
+static bool handle(uint8_t method, uint8_t type, uint8_t peer, uint16_t mid, const char *query)
+{
+	static const uint8_t token[] = {0xd0, 0x07};
+	uint8_t buf[64];
+	struct coap_packet request;
+	struct sockaddr_in6 addr;
+	int before;
+	int after;
+	int len;
+	int ret;
+
+	ret = coap_packet_init(&request, buf, sizeof(buf), COAP_VERSION_1, type, sizeof(token),
+			       token, method, mid);
+	zassert_ok(ret);
+
+	ret = coap_packet_append_option(&request, COAP_OPTION_URI_PATH, "door", strlen("door"));
+	zassert_ok(ret);
+
+	if (query) {
+		ret = coap_packet_append_option(&request, COAP_OPTION_URI_QUERY, query,
+						strlen(query));
+		zassert_ok(ret);
+	}
+
+	/* Parse it back as the CoAP service would */
+	len = request.offset;
+	ret = coap_packet_parse(&request, buf, len, NULL, 0);
+	zassert_ok(ret);
+
+	peer_addr(peer, &addr);
+	sent = 0;
+
+	before = gpio_emul_output_get(door_led.port, door_led.pin);
+
+	if (method == COAP_METHOD_GET) {
+		ret = door.get(&door, &request, (struct sockaddr *)&addr, sizeof(addr));
+	} else {
+		ret = door.post(&door, &request, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	zassert_ok(ret, "handler failed, err %d", ret);
+
+	after = gpio_emul_output_get(door_led.port, door_led.pin);
+
+	return before != after;
+}
+
+static void post(struct command *cmd)
+{
+	bool actuated;
+
+	actuated = handle(COAP_METHOD_POST, cmd->type, cmd->peer, cmd->mid, NULL);
+	actuations[cmd->peer][cmd->mid] += actuated;
+
+	zassert_equal(sent, 1, "POST from peer %u mid %u not answered", cmd->peer, cmd->mid);
+	zassert_equal(last_code, COAP_RESPONSE_CODE_CHANGED);
+	zassert_equal(actuations[cmd->peer][cmd->mid], 1,
+		      "peer %u mid %u actuated %u times", cmd->peer, cmd->mid,
+		      actuations[cmd->peer][cmd->mid]);
+
+	/* Duplicates refresh the server side entry as well */
+	cmd->expiry = sim_ticks + window_ticks;
+}
+
+static void new_command(struct command *cmd, uint8_t peer)
+{
+	cmd->peer = peer;
+	cmd->mid = ++next_mid[peer];
+	cmd->type = rng() % 2 ? COAP_TYPE_CON : COAP_TYPE_NON_CON;
+	cmd->live = true;
+
+	actuations[cmd->peer][cmd->mid] = 0;
+}
+
+static void expire_all(void)
+{
+	advance(window_ticks + 1);
+	memset(commands, 0, sizeof(commands));
+}
+
+/*
+ * Fill every cache slot and duplicate each command. A slot that never
+ * frees up would force an eviction and the duplicate of the evicted
+ * command would actuate again.
+ */
+static void assert_cache_free(void)
+{
+	int i;
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		new_command(&commands[i], i % PEER_COUNT);
+		post(&commands[i]);
+	}
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		post(&commands[i]);
+	}
+
+	expire_all();
+}
+
+static void *door_setup(void)
+{
+	zassert_ok(door_init());
+
+	window_ticks = K_MSEC(CONFIG_COAP_INIT_ACK_TIMEOUT_MS * 3).ticks;
+
+	return NULL;
+}
+
+static void door_before(void *fixture)
+{
+	rng_state = SEED;
+	expire_all();
+}
+
+ZTEST(door, test_randomized_sequences)
+{
+	struct command *cmd;
+	uint64_t started_us;
+	uint64_t elapsed_us;
+	uint32_t handlers = 0;
+	uint32_t unique = 0;
+	uint32_t toggles = 0;
+	uint32_t live;
+	char query[sizeof("id=255")];
+	uint32_t op;
+	int level;
+	int i;
+	int n;
+
+	snprintf(query, sizeof(query), "id=%u", (CONFIG_APP_DOOR_ID + 1) % 256);
+
+	level = gpio_emul_output_get(door_led.port, door_led.pin);
+	started_us = host_clock_us();
+
+	for (n = 0; n < ITERATIONS; n++) {
+		/* Small steps so most duplicates land inside the window */
+		advance(rng() % (window_ticks / 4 + 1));
+
+		live = 0;
+		for (i = 0; i < CACHE_SIZE; i++) {
+			if (!commands[i].live) {
+				continue;
+			}
+
+			if (commands[i].expiry <= sim_ticks) {
+				zassert_equal(actuations[commands[i].peer][commands[i].mid], 1);
+				commands[i].live = false;
+				unique++;
+				continue;
+			}
+
+			live++;
+		}
+
+		op = rng() % 100;
+		handlers++;
+
+		if (op < 30 && live < CACHE_SIZE) {
+			/* New command, only while the cache can hold it */
+			for (cmd = commands; cmd->live; cmd++) {
+			}
+
+			new_command(cmd, rng() % PEER_COUNT);
+			post(cmd);
+			toggles++;
+		} else if (op < 80 && live) {
+			/* Duplicate of any live command, in any order */
+			do {
+				cmd = &commands[rng() % CACHE_SIZE];
+			} while (!cmd->live);
+
+			post(cmd);
+		} else if (op < 95) {
+			/* GETs are answered every time and never actuate */
+			zassert_false(handle(COAP_METHOD_GET, COAP_TYPE_CON, rng() % PEER_COUNT,
+					     rng(), NULL));
+			zassert_equal(sent, 1);
+			zassert_equal(last_code, COAP_RESPONSE_CODE_CONTENT);
+		} else {
+			/* Commands for another door are ignored */
+			zassert_false(handle(COAP_METHOD_POST, COAP_TYPE_NON_CON,
+					     rng() % PEER_COUNT, rng(), query));
+			zassert_equal(sent, 0);
+		}
+	}
+
+	elapsed_us = host_clock_us() - started_us;
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (commands[i].live) {
+			zassert_equal(actuations[commands[i].peer][commands[i].mid], 1);
+			unique++;
+		}
+	}
+
+	zassert_equal(unique, toggles);
+	zassert_equal(gpio_emul_output_get(door_led.port, door_led.pin), level ^ (toggles % 2));
+
+	TC_PRINT("%u handlers, %u unique commands in %llu ms, %llu handlers/s\n", handlers,
+		 unique, elapsed_us / 1000, (uint64_t)handlers * USEC_PER_SEC / MAX(elapsed_us, 1));
+
+	expire_all();
+	assert_cache_free();
+}
+
+ZTEST(door, test_no_slot_leak)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		assert_cache_free();
+	}
+}
+
+ZTEST(door, test_duplicate_refreshes_window)
+{
+	struct command *cmd = &commands[0];
+
+	new_command(cmd, 0);
+	post(cmd);
+
+	/* Each duplicate comes later than the previous entry timeout */
+	advance(window_ticks - 1);
+	post(cmd);
+	advance(window_ticks - 1);
+	post(cmd);
+
+	/* Once the window passed without duplicates it is a new command */
+	advance(window_ticks);
+	actuations[cmd->peer][cmd->mid] = 0;
+	post(cmd);
+}
+
+ZTEST(door, test_eviction_under_pressure)
+{
+	struct command extra;
+	struct command *evicted;
+	int i;
+
+	BUILD_ASSERT(CACHE_SIZE >= 2);
+
+	/* One tick apart so every entry has its own timeout */
+	for (i = 0; i < CACHE_SIZE; i++) {
+		new_command(&commands[i], i % PEER_COUNT);
+		post(&commands[i]);
+		advance(1);
+	}
+
+	/* Refreshing the oldest leaves the second closest to expiry */
+	post(&commands[0]);
+	advance(1);
+	evicted = &commands[1];
+
+	/* One more live command than slots */
+	new_command(&extra, PEER_COUNT - 1);
+	post(&extra);
+
+	/* Every command still remembered is deduplicated */
+	post(&extra);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (&commands[i] != evicted) {
+			post(&commands[i]);
+		}
+	}
+
+	/* Only the entry closest to expiry was dropped, its duplicate acts again */
+	zassert_true(handle(COAP_METHOD_POST, evicted->type, evicted->peer, evicted->mid, NULL));
+	zassert_equal(sent, 1);
+	zassert_equal(last_code, COAP_RESPONSE_CODE_CHANGED);
+}
+
+ZTEST(door, test_get_does_not_evict_post)
+{
+	struct command *cmd = &commands[0];
+	int i;
+
+	new_command(cmd, 0);
+	post(cmd);
+
+	for (i = 0; i < CACHE_SIZE * 10; i++) {
+		zassert_false(handle(COAP_METHOD_GET, COAP_TYPE_CON, i % PEER_COUNT, i + 1, NULL));
+	}
+
+	post(cmd);
+}
+
+ZTEST(door, test_invalid_door_id)
+{
+	char query[sizeof("id=255")];
+
+	zassert_false(handle(COAP_METHOD_POST, COAP_TYPE_CON, 0, 1, "id=abc"));
+	zassert_equal(sent, 1);
+	zassert_equal(last_code, COAP_RESPONSE_CODE_BAD_REQUEST);
+
+	zassert_false(handle(COAP_METHOD_POST, COAP_TYPE_CON, 0, 2, "id=256"));
+	zassert_equal(sent, 1);
+	zassert_equal(last_code, COAP_RESPONSE_CODE_BAD_REQUEST);
+
+	/* Only multicast, hence NON, requests for another door go unanswered */
+	snprintf(query, sizeof(query), "id=%u", (CONFIG_APP_DOOR_ID + 1) % 256);
+	zassert_false(handle(COAP_METHOD_POST, COAP_TYPE_NON_CON, 0, 3, query));
+	zassert_equal(sent, 0);
+
+	zassert_false(handle(COAP_METHOD_POST, COAP_TYPE_CON, 0, 5, query));
+	zassert_equal(sent, 1);
+	zassert_equal(last_code, COAP_RESPONSE_CODE_NOT_FOUND);
+
+	snprintf(query, sizeof(query), "id=%u", CONFIG_APP_DOOR_ID);
+	zassert_true(handle(COAP_METHOD_POST, COAP_TYPE_CON, 0, 4, query));
+	zassert_equal(last_code, COAP_RESPONSE_CODE_CHANGED);
+}
+
+ZTEST_SUITE(door, NULL, door_setup, door_before, NULL, NULL);
@@ -0,0 +1,563 @@
+/*
+ * Host side CoAP load generator for the door server.
+ *
+ * Keeps a number of requests in flight against the server, mixing
+ * CON/NON, GET/POST, duplicated and malformed messages, and reports
+ * throughput, latency percentiles and dedup correctness.
+ *
+ * Build: cc -O2 -Wall -o coap-load coap-load.c
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COAP_PORT		5683
+#define COAP_PATH		"door"
+#define COAP_MAX_MSG		256
+#define COAP_TOKEN_LEN		4
+#define COAP_TOKEN_MAX_LEN	8
+#define MAX_SLOTS		64
+#define MAX_TEMPLATES		256
+
+#define COAP_TYPE_CON		0
+#define COAP_TYPE_NON		1
+#define COAP_TYPE_ACK		2
+#define COAP_TYPE_RST		3
+
+#define COAP_METHOD_GET		1
+#define COAP_METHOD_POST	2
+#define COAP_CODE_CONTENT	0x45
+#define COAP_CODE_CHANGED	0x44
+
+#define COAP_OPTION_URI_PATH	11
+
+enum kind {
+	KIND_REQUEST,
+	KIND_DUPLICATE,
+};
+
+struct config {
+	struct sockaddr_in6 addr;
+	unsigned int count;
+	unsigned int concurrency;
+	unsigned int timeout_ms;
+	unsigned int non_pct;
+	unsigned int get_pct;
+	unsigned int dup_pct;
+	unsigned int malformed_pct;
+	const char *replay;
+};
+
+struct slot {
+	int fd;
+	bool busy;
+	enum kind kind;
+	uint8_t method;
+	uint8_t type;
+	uint16_t mid;
+	uint8_t tkl;
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t msg[COAP_MAX_MSG];
+	size_t len;
+	uint64_t sent_at;
+	unsigned int answers;
+};
+
+struct stats {
+	unsigned int sent;
+	unsigned int answered;
+	unsigned int timeouts;
+	unsigned int duplicates;
+	unsigned int dup_answered;
+	unsigned int dup_errors;
+	unsigned int malformed;
+	unsigned int malformed_answered;
+	unsigned int bad_responses;
+	uint32_t *latency_us;
+	unsigned int latency_count;
+};
+
+struct template {
+	uint8_t msg[COAP_MAX_MSG];
+	size_t len;
+};
+
+static struct template templates[MAX_TEMPLATES];
+static unsigned int template_count;
+static uint16_t next_mid;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool chance(unsigned int pct)
+{
+	return (unsigned int)(rand() % 100) < pct;
+}
+
+static size_t encode_request(uint8_t *buf, uint8_t type, uint8_t method, uint16_t mid,
+			     const uint8_t *token)
+{
+	size_t len = 0;
+	size_t path_len = strlen(COAP_PATH);
+
+	buf[len++] = 0x40 | (type << 4) | COAP_TOKEN_LEN;
+	buf[len++] = method;
+	buf[len++] = mid >> 8;
+	buf[len++] = mid & 0xff;
+	memcpy(&buf[len], token, COAP_TOKEN_LEN);
+	len += COAP_TOKEN_LEN;
+
+	buf[len++] = (COAP_OPTION_URI_PATH << 4) | path_len;
+	memcpy(&buf[len], COAP_PATH, path_len);
+	len += path_len;
+
+	return len;
+}
+
+/*
+ * Reuse a captured message, only patching type, MID and as many token
+ * bytes as the capture carries.
+ */
+static size_t encode_replay(uint8_t *buf, uint8_t type, uint16_t mid, const uint8_t *token,
+			    uint8_t *tkl)
+{
+	const struct template *t = &templates[rand() % template_count];
+
+	memcpy(buf, t->msg, t->len);
+	*tkl = buf[0] & 0x0f;
+	buf[0] = (buf[0] & 0xcf) | (type << 4);
+	buf[2] = mid >> 8;
+	buf[3] = mid & 0xff;
+	memcpy(&buf[4], token, *tkl);
+
+	return t->len;
+}
+
+static size_t encode_malformed(uint8_t *buf)
+{
+	size_t len;
+
+	switch (rand() % 4) {
+	case 0:
+		/* Wrong version */
+		len = encode_request(buf, COAP_TYPE_CON, COAP_METHOD_POST, next_mid++,
+				     (uint8_t[COAP_TOKEN_LEN]){0});
+		buf[0] &= 0x3f;
+		return len;
+	case 1:
+		/* Reserved token length */
+		len = encode_request(buf, COAP_TYPE_CON, COAP_METHOD_POST, next_mid++,
+				     (uint8_t[COAP_TOKEN_LEN]){0});
+		buf[0] = (buf[0] & 0xf0) | 0x0f;
+		return len;
+	case 2:
+		/* Option running past the end of the message */
+		len = encode_request(buf, COAP_TYPE_CON, COAP_METHOD_POST, next_mid++,
+				     (uint8_t[COAP_TOKEN_LEN]){0});
+		buf[4 + COAP_TOKEN_LEN] = (COAP_OPTION_URI_PATH << 4) | 0x0c;
+		return len;
+	default:
+		/* Truncated header */
+		buf[0] = 0x40;
+		buf[1] = COAP_METHOD_GET;
+		return 2;
+	}
+}
+
+static int slot_send(struct slot *slot)
+{
+	ssize_t ret;
+
+	slot->sent_at = now_us();
+
+	ret = send(slot->fd, slot->msg, slot->len, 0);
+	if (ret < 0) {
+		fprintf(stderr, "send: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Malformed messages go out on their own socket. The server should not
+ * answer them, so they never hold a slot and leave the concurrency and
+ * the throughput alone.
+ */
+static int send_malformed(int fd, struct stats *stats)
+{
+	uint8_t msg[COAP_MAX_MSG];
+	size_t len;
+
+	len = encode_malformed(msg);
+	stats->malformed++;
+	stats->sent++;
+
+	if (send(fd, msg, len, 0) < 0) {
+		fprintf(stderr, "send: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void malformed_receive(int fd, struct stats *stats)
+{
+	uint8_t buf[COAP_MAX_MSG];
+
+	if (recv(fd, buf, sizeof(buf), 0) >= 0) {
+		stats->malformed_answered++;
+	}
+}
+
+static int slot_start(struct slot *slot, const struct config *cfg, struct stats *stats)
+{
+	int ret;
+	int i;
+
+	slot->answers = 0;
+
+	if (slot->kind == KIND_REQUEST && slot->mid != 0 && chance(cfg->dup_pct)) {
+		/* Resend the previous request unchanged from the same socket */
+		slot->kind = KIND_DUPLICATE;
+		stats->duplicates++;
+	} else {
+		slot->kind = KIND_REQUEST;
+		slot->type = chance(cfg->non_pct) ? COAP_TYPE_NON : COAP_TYPE_CON;
+		slot->method = chance(cfg->get_pct) ? COAP_METHOD_GET : COAP_METHOD_POST;
+		slot->mid = next_mid++;
+		if (slot->mid == 0) {
+			slot->mid = next_mid++;
+		}
+		for (i = 0; i < COAP_TOKEN_MAX_LEN; i++) {
+			slot->token[i] = rand();
+		}
+
+		if (template_count) {
+			slot->len = encode_replay(slot->msg, slot->type, slot->mid, slot->token,
+						  &slot->tkl);
+			slot->method = slot->msg[1];
+		} else {
+			slot->tkl = COAP_TOKEN_LEN;
+			slot->len = encode_request(slot->msg, slot->type, slot->method, slot->mid,
+						   slot->token);
+		}
+	}
+
+	stats->sent++;
+
+	ret = slot_send(slot);
+	if (ret < 0) {
+		return ret;
+	}
+
+	slot->busy = true;
+
+	return 0;
+}
+
+static void slot_finish(struct slot *slot, struct stats *stats, bool timed_out)
+{
+	slot->busy = false;
+
+	switch (slot->kind) {
+	case KIND_REQUEST:
+		if (timed_out) {
+			stats->timeouts++;
+		}
+		break;
+	case KIND_DUPLICATE:
+		/* The server answers every duplicate again */
+		if (slot->answers) {
+			stats->dup_answered++;
+		} else {
+			stats->dup_errors++;
+		}
+		slot->mid = 0;
+		break;
+	}
+}
+
+/* Returns true once the slot is done with its message. */
+static bool slot_receive(struct slot *slot, struct stats *stats)
+{
+	uint8_t buf[COAP_MAX_MSG];
+	uint8_t expected;
+	uint16_t mid;
+	ssize_t len;
+
+	len = recv(slot->fd, buf, sizeof(buf), 0);
+	if (len < 0) {
+		return false;
+	}
+
+	if (!slot->busy) {
+		stats->bad_responses++;
+		return false;
+	}
+
+	slot->answers++;
+
+	mid = (buf[2] << 8) | buf[3];
+	expected = slot->method == COAP_METHOD_GET ? COAP_CODE_CONTENT : COAP_CODE_CHANGED;
+
+	if (len < 4 + slot->tkl || (buf[0] & 0x0f) != slot->tkl ||
+	    memcmp(&buf[4], slot->token, slot->tkl) != 0 || buf[1] != expected ||
+	    (slot->type == COAP_TYPE_CON && mid != slot->mid)) {
+		stats->bad_responses++;
+	}
+
+	if (slot->kind == KIND_REQUEST) {
+		stats->answered++;
+		stats->latency_us[stats->latency_count++] = now_us() - slot->sent_at;
+		slot_finish(slot, stats, false);
+		return true;
+	}
+
+	slot_finish(slot, stats, false);
+	return true;
+}
+
+static int load_replay(const char *path)
+{
+	char line[2 * COAP_MAX_MSG + 2];
+	struct template *t;
+	unsigned int byte;
+	size_t i;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	/* One hex encoded CoAP message per line */
+	while (template_count < MAX_TEMPLATES && fgets(line, sizeof(line), f)) {
+		t = &templates[template_count];
+		t->len = 0;
+
+		for (i = 0; line[i] && line[i + 1] && line[i] != '\n'; i += 2) {
+			if (sscanf(&line[i], "%2x", &byte) != 1) {
+				break;
+			}
+			t->msg[t->len++] = byte;
+		}
+
+		if (t->len >= 4 && (t->msg[0] & 0x0f) <= COAP_TOKEN_MAX_LEN &&
+		    t->len >= 4 + (size_t)(t->msg[0] & 0x0f)) {
+			template_count++;
+		}
+	}
+
+	fclose(f);
+
+	if (!template_count) {
+		fprintf(stderr, "%s: no message\n", path);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const struct stats *stats, unsigned int pct)
+{
+	if (!stats->latency_count) {
+		return 0;
+	}
+
+	return stats->latency_us[(stats->latency_count - 1) * pct / 100];
+}
+
+static void report(struct stats *stats, uint64_t elapsed_us)
+{
+	qsort(stats->latency_us, stats->latency_count, sizeof(uint32_t), compare_u32);
+
+	printf("sent:        %u\n", stats->sent);
+	printf("answered:    %u\n", stats->answered);
+	printf("timeouts:    %u\n", stats->timeouts);
+	printf("throughput:  %.1f req/s\n", stats->answered * 1e6 / elapsed_us);
+	printf("latency us:  p50 %u p90 %u p99 %u max %u\n", percentile(stats, 50),
+	       percentile(stats, 90), percentile(stats, 99), percentile(stats, 100));
+	printf("duplicates:  %u (answered %u, dedup errors %u)\n", stats->duplicates,
+	       stats->dup_answered, stats->dup_errors);
+	printf("malformed:   %u (answered %u)\n", stats->malformed, stats->malformed_answered);
+	printf("bad replies: %u\n", stats->bad_responses);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-n count] [-c concurrency] [-t timeout_ms] [-N non_pct]\n"
+		"          [-g get_pct] [-d dup_pct] [-m malformed_pct] [-r replay_file]\n"
+		"          [-s seed] address [port]\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg = {
+		.count = 1000,
+		.concurrency = 1,
+		.timeout_ms = 2000,
+		.non_pct = 0,
+		.get_pct = 0,
+		.dup_pct = 0,
+		.malformed_pct = 0,
+	};
+	struct slot slots[MAX_SLOTS];
+	struct pollfd fds[MAX_SLOTS + 1];
+	int malformed_fd;
+	struct stats stats = {0};
+	unsigned int started = 0;
+	unsigned int running = 0;
+	unsigned int seed = time(NULL);
+	uint64_t start;
+	uint64_t now;
+	unsigned int i;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "n:c:t:N:g:d:m:r:s:")) != -1) {
+		switch (opt) {
+		case 'n': cfg.count = atoi(optarg); break;
+		case 'c': cfg.concurrency = atoi(optarg); break;
+		case 't': cfg.timeout_ms = atoi(optarg); break;
+		case 'N': cfg.non_pct = atoi(optarg); break;
+		case 'g': cfg.get_pct = atoi(optarg); break;
+		case 'd': cfg.dup_pct = atoi(optarg); break;
+		case 'm': cfg.malformed_pct = atoi(optarg); break;
+		case 'r': cfg.replay = optarg; break;
+		case 's': seed = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc || cfg.concurrency == 0 || cfg.concurrency > MAX_SLOTS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	cfg.addr.sin6_family = AF_INET6;
+	cfg.addr.sin6_port = htons(optind + 1 < argc ? atoi(argv[optind + 1]) : COAP_PORT);
+	if (inet_pton(AF_INET6, argv[optind], &cfg.addr.sin6_addr) != 1) {
+		fprintf(stderr, "invalid address: %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (cfg.replay && load_replay(cfg.replay) < 0) {
+		return 1;
+	}
+
+	srand(seed);
+	next_mid = rand();
+
+	stats.latency_us = calloc(cfg.count, sizeof(uint32_t));
+	if (!stats.latency_us) {
+		return 1;
+	}
+
+	for (i = 0; i < cfg.concurrency; i++) {
+		memset(&slots[i], 0, sizeof(slots[i]));
+
+		slots[i].fd = socket(AF_INET6, SOCK_DGRAM, 0);
+		if (slots[i].fd < 0 ||
+		    connect(slots[i].fd, (struct sockaddr *)&cfg.addr, sizeof(cfg.addr)) < 0) {
+			fprintf(stderr, "socket: %s\n", strerror(errno));
+			return 1;
+		}
+
+		fds[i].fd = slots[i].fd;
+		fds[i].events = POLLIN;
+	}
+
+	malformed_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+	if (malformed_fd < 0 ||
+	    connect(malformed_fd, (struct sockaddr *)&cfg.addr, sizeof(cfg.addr)) < 0) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	fds[cfg.concurrency].fd = malformed_fd;
+	fds[cfg.concurrency].events = POLLIN;
+
+	start = now_us();
+
+	while (started < cfg.count || running) {
+		for (i = 0; i < cfg.concurrency; i++) {
+			while (!slots[i].busy && started < cfg.count &&
+			       chance(cfg.malformed_pct)) {
+				send_malformed(malformed_fd, &stats);
+				started++;
+			}
+
+			if (!slots[i].busy && started < cfg.count) {
+				if (slot_start(&slots[i], &cfg, &stats) == 0) {
+					running++;
+				}
+				started++;
+			}
+		}
+
+		ret = poll(fds, cfg.concurrency + 1, 10);
+		if (ret < 0 && errno != EINTR) {
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			return 1;
+		}
+
+		now = now_us();
+
+		if (fds[cfg.concurrency].revents & POLLIN) {
+			malformed_receive(malformed_fd, &stats);
+		}
+
+		for (i = 0; i < cfg.concurrency; i++) {
+			if ((fds[i].revents & POLLIN) && slot_receive(&slots[i], &stats)) {
+				running--;
+			}
+
+			/* Unanswered duplicates complete once the timeout expires */
+			if (slots[i].busy &&
+			    now - slots[i].sent_at > (uint64_t)cfg.timeout_ms * 1000) {
+				slot_finish(&slots[i], &stats, true);
+				running--;
+			}
+		}
+	}
+
+	report(&stats, now_us() - start);
+
+	for (i = 0; i < cfg.concurrency; i++) {
+		close(slots[i].fd);
+	}
+	close(malformed_fd);
+	free(stats.latency_us);
+
+	return stats.dup_errors || stats.bad_responses ? 2 : 0;
+}